@@ -1,9 +1,12 @@
 ﻿#include <windows.h>
+#include <bcrypt.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 
+#pragma comment(lib, "bcrypt.lib")
+
 #define RING_BUFFER_SIZE 8192
 #define MAX_PACKET_SIZE 8192
 #define MAX_RESPONSE_SIZE 8192
@@ -11,12 +14,21 @@
 #define MAX_OFFSET_RETRIES 5
 
 
+// Counters used to measure ring buffer contention. Only --bench reads them, but they are
+// updated on every lock and stall in the normal receive path too, so keep them cheap.
+typedef struct {
+    long long lockAcquisitions;
+    long long producerStallTicks; // QueryPerformanceCounter ticks spent waiting for free space
+    long long consumerStallTicks; // QueryPerformanceCounter ticks spent waiting for data
+} RingBufferStats;
+
 typedef struct {
     char buffer[RING_BUFFER_SIZE];
     int head;
     int tail;
     int count;
     CRITICAL_SECTION lock;
+    RingBufferStats stats;
 } RingBuffer;
 
 typedef struct {
@@ -31,11 +43,27 @@ void ring_buffer_init(RingBuffer* rb) {
     rb->head = 0;
     rb->tail = 0;
     rb->count = 0;
+    memset(&rb->stats, 0, sizeof(rb->stats));
     InitializeCriticalSection(&rb->lock);
 }
 
-int ring_buffer_put(RingBuffer* rb, char data) {
+// Enter the ring buffer lock and count the acquisition
+static void ring_buffer_lock(RingBuffer* rb) {
     EnterCriticalSection(&rb->lock);
+    rb->stats.lockAcquisitions++;
+}
+
+// Sleep briefly while the other side catches up, adding the time spent to *ticks
+static void ring_buffer_stall(long long* ticks) {
+    LARGE_INTEGER t0, t1;
+    QueryPerformanceCounter(&t0);
+    Sleep(1);
+    QueryPerformanceCounter(&t1);
+    *ticks += t1.QuadPart - t0.QuadPart;
+}
+
+int ring_buffer_put(RingBuffer* rb, char data) {
+    ring_buffer_lock(rb);
 
     if (rb->count >= RING_BUFFER_SIZE) {
         LeaveCriticalSection(&rb->lock);
@@ -52,7 +80,7 @@ int ring_buffer_put(RingBuffer* rb, char data) {
 
 // Bulk write 'len' bytes from src into ring buffer (returns bytes written)
 int ring_buffer_put_bulk(RingBuffer* rb, const char* src, int len) {
-    EnterCriticalSection(&rb->lock);
+    ring_buffer_lock(rb);
     if (len <= 0) {
         LeaveCriticalSection(&rb->lock);
         return 0;
@@ -81,7 +109,7 @@ int ring_buffer_put_bulk(RingBuffer* rb, const char* src, int len) {
 }
 
 int ring_buffer_get(RingBuffer* rb, char* data) {
-    EnterCriticalSection(&rb->lock);
+    ring_buffer_lock(rb);
 
     if (rb->count <= 0) {
         LeaveCriticalSection(&rb->lock);
@@ -103,7 +131,7 @@ int ring_buffer_available(RingBuffer* rb) {
 // Peek at a byte at 'index' (0..count-1) from tail without removing it.
 // Returns 1 on success and sets *out, 0 if index out of range.
 int ring_buffer_peek(RingBuffer* rb, int index, char* out) {
-    EnterCriticalSection(&rb->lock);
+    ring_buffer_lock(rb);
     if (index < 0 || index >= rb->count) {
         LeaveCriticalSection(&rb->lock);
         return 0;
@@ -116,7 +144,7 @@ int ring_buffer_peek(RingBuffer* rb, int index, char* out) {
 
 // Find first occurrence of 'ch' in buffer; returns zero-based index from tail or -1 if not found.
 int ring_buffer_find_char(RingBuffer* rb, char ch) {
-    EnterCriticalSection(&rb->lock);
+    ring_buffer_lock(rb);
     int cnt = rb->count;
     if (cnt <= 0) {
         LeaveCriticalSection(&rb->lock);
@@ -159,7 +187,7 @@ int ring_buffer_find_char(RingBuffer* rb, char ch) {
 
 // Read up to 'length' bytes from buffer into dest, removing them. Returns bytes read.
 int ring_buffer_read_bulk(RingBuffer* rb, char* dest, int length) {
-    EnterCriticalSection(&rb->lock);
+    ring_buffer_lock(rb);
     if (length <= 0 || rb->count == 0) {
         LeaveCriticalSection(&rb->lock);
         return 0;
@@ -185,6 +213,20 @@ int ring_buffer_read_bulk(RingBuffer* rb, char* dest, int length) {
     return toRead;
 }
 
+// Write all 'len' bytes from src into ring buffer, waiting for the consumer while it is full
+void ring_buffer_write_all(RingBuffer* rb, const char* src, int len) {
+    while (len > 0) {
+        int w = ring_buffer_put_bulk(rb, src, len);
+        if (w <= 0) {
+            // buffer full, wait for consumer
+            ring_buffer_stall(&rb->stats.producerStallTicks);
+            continue;
+        }
+        src += w;
+        len -= w;
+    }
+}
+
 // Serial receive thread (uses OVERLAPPED asynchronous reads to reduce blocking)
 DWORD WINAPI serial_receive_thread(LPVOID param) {
     SerialPort* serial = (SerialPort*)param;
@@ -216,18 +258,7 @@ DWORD WINAPI serial_receive_thread(LPVOID param) {
         }
 
         if (bytesRead > 0) {
-            int remaining = (int)bytesRead;
-            char* ptr = readBuffer;
-            while (remaining > 0) {
-                int w = ring_buffer_put_bulk(serial->rxBuffer, ptr, remaining);
-                if (w <= 0) {
-                    // buffer full, wait for consumer
-                    Sleep(1);
-                    continue;
-                }
-                ptr += w;
-                remaining -= w;
-            }
+            ring_buffer_write_all(serial->rxBuffer, readBuffer, (int)bytesRead);
         }
     }
 
@@ -405,6 +436,29 @@ void enumerate_serial_ports() {
     }
 }
 
+// Parse a "+CFTPSGET: DATA,<len>" frame header; returns <len>, or -1 if the line is not a DATA header
+int parse_data_frame_header(const char* line) {
+    if (strstr(line, "+CFTPSGET: DATA,") == NULL) return -1;
+    const char* data_pos = strstr(line, "DATA,");
+    if (!data_pos) return -1;
+    int data_len = atoi(data_pos + 5);
+    return data_len > 0 ? data_len : 0;
+}
+
+// Read the 'data_len' binary bytes that follow a DATA header, waiting until they all arrive
+void read_data_frame_payload(RingBuffer* rb, char* data, int data_len) {
+    int bytes_read = 0;
+
+    while (bytes_read < data_len) {
+        if (ring_buffer_get(rb, &data[bytes_read])) {
+            bytes_read++;
+        }
+        else {
+            ring_buffer_stall(&rb->stats.consumerStallTicks);
+        }
+    }
+}
+
 // Download file data
 int download_file_data(HANDLE hCom, RingBuffer* rb, const char* filename, int total_size) {
     FILE* file;
@@ -442,49 +496,34 @@ int download_file_data(HANDLE hCom, RingBuffer* rb, const char* filename, int to
 
             printf("Received: %s", line);
 
-            if (strstr(line, "+CFTPSGET: DATA,") != NULL) {
-                // Parse data length
-                const char* data_pos = strstr(line, "DATA,");
-                if (data_pos) {
-                    data_pos += 5;
-                    int data_len = atoi(data_pos);
-
-                    if (data_len > 0) {
-                        // Read binary data
-                        char* data = (char*)malloc(data_len);
-                        int bytes_read = 0;
-
-                        while (bytes_read < data_len) {
-                            if (ring_buffer_get(rb, &data[bytes_read])) {
-                                bytes_read++;
-                            }
-                            else {
-                                Sleep(1);
-                            }
-                        }
-
-                        // Print 16-byte-per-line hex view with offset relative to bytes already received
-                        for (int i = 0; i < data_len; ++i) {
-                            if ((i % 16) == 0) {
-                                // display the starting offset for this line
-                                printf("\n%08X: ", bytes_received + i);
-                            }
-                            printf("%02X ", (unsigned char)data[i]);
+            int data_len = parse_data_frame_header(line);
+            if (data_len >= 0) {
+                if (data_len > 0) {
+                    // Read binary data
+                    char* data = (char*)malloc(data_len);
+                    read_data_frame_payload(rb, data, data_len);
+
+                    // Print 16-byte-per-line hex view with offset relative to bytes already received
+                    for (int i = 0; i < data_len; ++i) {
+                        if ((i % 16) == 0) {
+                            // display the starting offset for this line
+                            printf("\n%08X: ", bytes_received + i);
                         }
-                        printf("\n");
+                        printf("%02X ", (unsigned char)data[i]);
+                    }
+                    printf("\n");
 
-                        // Write to file
-                        fwrite(data, 1, data_len, file);
-                        fflush(file);
+                    // Write to file
+                    fwrite(data, 1, data_len, file);
+                    fflush(file);
 
-                        data_received += data_len;
-                        bytes_received += data_len;
-                        free(data);
+                    data_received += data_len;
+                    bytes_received += data_len;
+                    free(data);
 
-                        printf("Received %d bytes, total progress: %d/%d (%.1f%%)\n",
-                            data_len, bytes_received, total_size,
-                            (float)bytes_received / total_size * 100);
-                    }
+                    printf("Received %d bytes, total progress: %d/%d (%.1f%%)\n",
+                        data_len, bytes_received, total_size,
+                        (float)bytes_received / total_size * 100);
                 }
             }
             else if (strstr(line, "+CFTPSGET: 14") != NULL) {
@@ -531,6 +570,977 @@ int download_file_data(HANDLE hCom, RingBuffer* rb, const char* filename, int to
     return 1;
 }
 
+// ---------------------------------------------------------------------------
+// Local download cache
+//
+// Layout under the cache directory:
+//   objects\<sha256>   file contents, named by their SHA-256 (read-only)
+//   keys\<hash>.key    "<key>\n<size>\n<sha256>\n" for each server/user/path/size key
+//   lock               locked exclusively (LockFileEx) around every operation so
+//                      several tool instances can share one cache
+// A key file's last-write time is its LRU timestamp.
+// ---------------------------------------------------------------------------
+
+#define CACHE_DEFAULT_MAX_MB 1024
+// Large enough for the longest key main can build: user (127) @ server (127) : port /
+// filename (259) # size # sha256 (64); the key file line buffer adds room for "\r\n"
+#define CACHE_KEY_SIZE 640
+
+typedef struct {
+    char dir[MAX_PATH];
+    long long maxBytes;
+    int hardlink;   // materialize hits as read-only hardlinks instead of copies
+} DownloadCache;
+
+typedef struct {
+    char path[MAX_PATH];
+    char sha256[65];
+    FILETIME lastUsed;
+} CacheKeyEntry;
+
+typedef struct {
+    char sha256[65];
+    long long size;
+} CacheObjectEntry;
+
+// SHA-256 of a file as lowercase hex; returns 1 on success and sets *size
+static int sha256_file(const char* path, char hex[65], long long* size) {
+    BCRYPT_ALG_HANDLE hAlg = NULL;
+    BCRYPT_HASH_HANDLE hHash = NULL;
+    unsigned char digest[32];
+    char buffer[65536];
+    FILE* file;
+    size_t n;
+    int ok = 0;
+
+    if (fopen_s(&file, path, "rb") != 0) return 0;
+    *size = 0;
+    if (BCRYPT_SUCCESS(BCryptOpenAlgorithmProvider(&hAlg, BCRYPT_SHA256_ALGORITHM, NULL, 0)) &&
+        BCRYPT_SUCCESS(BCryptCreateHash(hAlg, &hHash, NULL, 0, NULL, 0, 0))) {
+        ok = 1;
+        while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+            if (!BCRYPT_SUCCESS(BCryptHashData(hHash, (PUCHAR)buffer, (ULONG)n, 0))) {
+                ok = 0;
+                break;
+            }
+            *size += (long long)n;
+        }
+        if (ok && (ferror(file) || !BCRYPT_SUCCESS(BCryptFinishHash(hHash, digest, sizeof(digest), 0)))) {
+            ok = 0;
+        }
+    }
+    if (hHash) BCryptDestroyHash(hHash);
+    if (hAlg) BCryptCloseAlgorithmProvider(hAlg, 0);
+    fclose(file);
+
+    if (ok) {
+        for (int i = 0; i < 32; ++i) {
+            sprintf_s(hex + i * 2, 3, "%02x", digest[i]);
+        }
+    }
+    return ok;
+}
+
+// Accept a 64-character hex SHA-256 and normalize it to lowercase
+static int normalize_sha256(const char* in, char out[65]) {
+    if (strlen(in) != 64) return 0;
+    for (int i = 0; i < 64; ++i) {
+        if (!isxdigit((unsigned char)in[i])) return 0;
+        out[i] = (char)tolower((unsigned char)in[i]);
+    }
+    out[64] = '\0';
+    return 1;
+}
+
+// Build the cache key from server, port, user, remote path, size and (optional) expected SHA-256.
+// The user is included because the remote path is resolved against the user's home directory.
+// Returns 0 if the key does not fit, rather than storing one that lost its size and digest.
+int cache_make_key(char* key, size_t keySize, const char* server, int port, const char* user, const char* path, int size, const char* sha256) {
+    int n;
+    if (sha256 && sha256[0]) {
+        n = snprintf(key, keySize, "%s@%s:%d/%s#%d#%s", user, server, port, path, size, sha256);
+    }
+    else {
+        n = snprintf(key, keySize, "%s@%s:%d/%s#%d", user, server, port, path, size);
+    }
+    return n > 0 && (size_t)n < keySize;
+}
+
+// FNV-1a 64-bit hash of the key, used as the key file name
+static void cache_key_path(const DownloadCache* cache, const char* key, char* out, size_t outSize) {
+    unsigned long long h = 14695981039346656037ull;
+    for (const char* p = key; *p; ++p) {
+        h ^= (unsigned char)*p;
+        h *= 1099511628211ull;
+    }
+    snprintf(out, outSize, "%s\\keys\\%016llx.key", cache->dir, h);
+}
+
+static void cache_object_path(const DownloadCache* cache, const char* sha256, char* out, size_t outSize) {
+    snprintf(out, outSize, "%s\\objects\\%s", cache->dir, sha256);
+}
+
+static int create_directory(const char* path) {
+    if (CreateDirectoryA(path, NULL) || GetLastError() == ERROR_ALREADY_EXISTS) return 1;
+    printf("Cache: unable to create directory %s (error %lu), cache disabled\n", path, GetLastError());
+    return 0;
+}
+
+// Objects are read-only, so clear the attribute before deleting one
+static void cache_delete_object(const char* path) {
+    SetFileAttributesA(path, FILE_ATTRIBUTE_NORMAL);
+    DeleteFileA(path);
+}
+
+// Returns 1 if 'path' exists and has more than one hardlink (e.g. it shares its data with a cache object)
+int file_is_hardlinked(const char* path) {
+    BY_HANDLE_FILE_INFORMATION info;
+    HANDLE h = CreateFileA(path, FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (h == INVALID_HANDLE_VALUE) return 0;
+    int linked = GetFileInformationByHandle(h, &info) && info.nNumberOfLinks > 1;
+    CloseHandle(h);
+    return linked;
+}
+
+// Set up the cache. The directory comes from SIMCOM_FTP_CACHE_DIR, defaulting to
+// %LOCALAPPDATA%\SIMCom FTP Tool\cache; the size budget in MB comes from
+// SIMCOM_FTP_CACHE_MAX_MB. Returns 1 if the cache is usable.
+int download_cache_open(DownloadCache* cache) {
+    char value[MAX_PATH];
+    char sub[MAX_PATH];
+    DWORD n;
+
+    cache->hardlink = 0;
+    cache->maxBytes = (long long)CACHE_DEFAULT_MAX_MB * 1024 * 1024;
+    n = GetEnvironmentVariableA("SIMCOM_FTP_CACHE_MAX_MB", value, sizeof(value));
+    if (n > 0 && n < sizeof(value) && atoi(value) > 0) {
+        cache->maxBytes = (long long)atoi(value) * 1024 * 1024;
+    }
+
+    n = GetEnvironmentVariableA("SIMCOM_FTP_CACHE_DIR", value, sizeof(value));
+    if (n > 0 && n < sizeof(value)) {
+        snprintf(cache->dir, sizeof(cache->dir), "%s", value);
+    }
+    else {
+        n = GetEnvironmentVariableA("LOCALAPPDATA", value, sizeof(value));
+        if (n == 0 || n >= sizeof(value)) {
+            printf("Cache: LOCALAPPDATA is not set and SIMCOM_FTP_CACHE_DIR is not given, cache disabled\n");
+            return 0;
+        }
+        snprintf(sub, sizeof(sub), "%s\\SIMCom FTP Tool", value);
+        if (!create_directory(sub)) return 0;
+        snprintf(cache->dir, sizeof(cache->dir), "%s\\cache", sub);
+    }
+
+    if (!create_directory(cache->dir)) return 0;
+    snprintf(sub, sizeof(sub), "%s\\objects", cache->dir);
+    if (!create_directory(sub)) return 0;
+    snprintf(sub, sizeof(sub), "%s\\keys", cache->dir);
+    if (!create_directory(sub)) return 0;
+    return 1;
+}
+
+// Take the cross-process cache lock; returns the lock file handle or INVALID_HANDLE_VALUE
+static HANDLE cache_lock(const DownloadCache* cache) {
+    char path[MAX_PATH];
+    OVERLAPPED ov = { 0 };
+
+    snprintf(path, sizeof(path), "%s\\lock", cache->dir);
+    HANDLE hLock = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+        OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hLock == INVALID_HANDLE_VALUE) return INVALID_HANDLE_VALUE;
+    if (!LockFileEx(hLock, LOCKFILE_EXCLUSIVE_LOCK, 0, 1, 0, &ov)) {
+        CloseHandle(hLock);
+        return INVALID_HANDLE_VALUE;
+    }
+    return hLock;
+}
+
+static void cache_unlock(HANDLE hLock) {
+    OVERLAPPED ov = { 0 };
+    UnlockFileEx(hLock, 0, 1, 0, &ov);
+    CloseHandle(hLock);
+}
+
+// Read a key file; returns 1 if it exists and belongs to 'key'
+static int cache_read_key(const char* keyPath, const char* key, long long* size, char sha256[65]) {
+    FILE* file;
+    char line[CACHE_KEY_SIZE + 2];
+    int ok = 0;
+
+    if (fopen_s(&file, keyPath, "r") != 0) return 0;
+    // A first line without its newline did not fit; treat the file as malformed
+    if (fgets(line, sizeof(line), file) && strchr(line, '\n') != NULL) {
+        line[strcspn(line, "\r\n")] = 0;
+        ok = (key == NULL || strcmp(line, key) == 0);
+    }
+    if (ok && fgets(line, sizeof(line), file)) {
+        *size = _atoi64(line);
+    }
+    else {
+        ok = 0;
+    }
+    if (ok && fgets(line, sizeof(line), file)) {
+        line[strcspn(line, "\r\n")] = 0;
+        ok = normalize_sha256(line, sha256);
+    }
+    else {
+        ok = 0;
+    }
+    fclose(file);
+    return ok;
+}
+
+// Mark a key as most recently used
+static void cache_touch(const char* keyPath) {
+    FILETIME now;
+    HANDLE h = CreateFileA(keyPath, FILE_WRITE_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (h == INVALID_HANDLE_VALUE) return;
+    GetSystemTimeAsFileTime(&now);
+    SetFileTime(h, NULL, NULL, &now);
+    CloseHandle(h);
+}
+
+static int compare_key_entries(const void* a, const void* b) {
+    return CompareFileTime(&((const CacheKeyEntry*)a)->lastUsed, &((const CacheKeyEntry*)b)->lastUsed);
+}
+
+static int cache_key_references(const CacheKeyEntry* keys, int count, const char* sha256) {
+    for (int i = 0; i < count; ++i) {
+        if (strcmp(keys[i].sha256, sha256) == 0) return 1;
+    }
+    return 0;
+}
+
+// Drop leftover temp files and unreferenced objects, then evict least recently used
+// keys until the objects fit in the size budget. Called with the cache lock held.
+static void cache_evict(const DownloadCache* cache) {
+    WIN32_FIND_DATAA fd;
+    HANDLE hFind;
+    char pattern[MAX_PATH];
+    char path[MAX_PATH];
+    CacheKeyEntry* keys = NULL;
+    CacheObjectEntry* objects = NULL;
+    int keyCount = 0, keyCap = 0;
+    int objectCount = 0, objectCap = 0;
+    long long total = 0;
+    long long size;
+
+    snprintf(pattern, sizeof(pattern), "%s\\keys\\*", cache->dir);
+    hFind = FindFirstFileA(pattern, &fd);
+    if (hFind != INVALID_HANDLE_VALUE) {
+        do {
+            if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) continue;
+            snprintf(path, sizeof(path), "%s\\keys\\%s", cache->dir, fd.cFileName);
+            if (strstr(fd.cFileName, ".tmp") != NULL) {
+                DeleteFileA(path);
+                continue;
+            }
+            if (keyCount == keyCap) {
+                keyCap = keyCap ? keyCap * 2 : 64;
+                CacheKeyEntry* grown = (CacheKeyEntry*)realloc(keys, keyCap * sizeof(CacheKeyEntry));
+                if (!grown) {
+                    FindClose(hFind);
+                    goto done;
+                }
+                keys = grown;
+            }
+            CacheKeyEntry* k = &keys[keyCount];
+            snprintf(k->path, sizeof(k->path), "%s", path);
+            k->lastUsed = fd.ftLastWriteTime;
+            if (cache_read_key(path, NULL, &size, k->sha256)) {
+                keyCount++;
+            }
+            else {
+                DeleteFileA(path);
+            }
+        } while (FindNextFileA(hFind, &fd));
+        FindClose(hFind);
+    }
+
+    snprintf(pattern, sizeof(pattern), "%s\\objects\\*", cache->dir);
+    hFind = FindFirstFileA(pattern, &fd);
+    if (hFind != INVALID_HANDLE_VALUE) {
+        do {
+            if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) continue;
+            snprintf(path, sizeof(path), "%s\\objects\\%s", cache->dir, fd.cFileName);
+            if (strstr(fd.cFileName, ".tmp") != NULL || !cache_key_references(keys, keyCount, fd.cFileName)) {
+                cache_delete_object(path);
+                continue;
+            }
+            if (objectCount == objectCap) {
+                objectCap = objectCap ? objectCap * 2 : 64;
+                CacheObjectEntry* grown = (CacheObjectEntry*)realloc(objects, objectCap * sizeof(CacheObjectEntry));
+                if (!grown) {
+                    FindClose(hFind);
+                    goto done;
+                }
+                objects = grown;
+            }
+            snprintf(objects[objectCount].sha256, sizeof(objects[objectCount].sha256), "%s", fd.cFileName);
+            objects[objectCount].size = ((long long)fd.nFileSizeHigh << 32) | fd.nFileSizeLow;
+            total += objects[objectCount].size;
+            objectCount++;
+        } while (FindNextFileA(hFind, &fd));
+        FindClose(hFind);
+    }
+
+    if (keyCount > 0) {
+        qsort(keys, keyCount, sizeof(CacheKeyEntry), compare_key_entries);
+    }
+    for (int i = 0; i < keyCount && total > cache->maxBytes; ++i) {
+        printf("Cache: evicting %s\n", keys[i].path);
+        DeleteFileA(keys[i].path);
+        if (cache_key_references(keys + i + 1, keyCount - i - 1, keys[i].sha256)) continue;
+        for (int j = 0; j < objectCount; ++j) {
+            if (strcmp(objects[j].sha256, keys[i].sha256) == 0) {
+                cache_object_path(cache, objects[j].sha256, path, sizeof(path));
+                cache_delete_object(path);
+                total -= objects[j].size;
+                break;
+            }
+        }
+    }
+
+done:
+    free(keys);
+    free(objects);
+}
+
+// Look up 'key' and, on a verified hit, materialize the contents as 'filename': a writable
+// copy, or with cache->hardlink a read-only hardlink (copy if linking fails). Returns 1 on a hit.
+int download_cache_fetch(const DownloadCache* cache, const char* key, int size, const char* filename) {
+    char keyPath[MAX_PATH];
+    char objectPath[MAX_PATH];
+    char sha256[65];
+    char actual[65];
+    long long storedSize = 0;
+    long long actualSize = 0;
+    int hit = 0;
+
+    HANDLE hLock = cache_lock(cache);
+    if (hLock == INVALID_HANDLE_VALUE) return 0;
+
+    cache_key_path(cache, key, keyPath, sizeof(keyPath));
+    if (cache_read_key(keyPath, key, &storedSize, sha256) && storedSize == size) {
+        cache_object_path(cache, sha256, objectPath, sizeof(objectPath));
+        // Verify the object before handing it out in case it was modified despite being read-only
+        if (sha256_file(objectPath, actual, &actualSize) && actualSize == size && strcmp(actual, sha256) == 0) {
+            // Remove the destination first so neither link nor copy writes through an old hardlink.
+            // Clearing its read-only attribute may clear the object's too, so restore that afterwards.
+            SetFileAttributesA(filename, FILE_ATTRIBUTE_NORMAL);
+            DeleteFileA(filename);
+            SetFileAttributesA(objectPath, FILE_ATTRIBUTE_READONLY);
+            if (cache->hardlink && CreateHardLinkA(filename, objectPath, NULL)) {
+                hit = 1;
+            }
+            else if (CopyFileA(objectPath, filename, FALSE)) {
+                // CopyFile carries the read-only attribute over; the copy belongs to the user
+                SetFileAttributesA(filename, FILE_ATTRIBUTE_NORMAL);
+                hit = 1;
+            }
+            if (hit) cache_touch(keyPath);
+        }
+        else {
+            printf("Cache: entry for %s failed verification, discarding\n", key);
+            cache_delete_object(objectPath);
+            DeleteFileA(keyPath);
+        }
+    }
+
+    cache_unlock(hLock);
+    return hit;
+}
+
+// Add a downloaded file to the cache under 'key', then evict down to the size budget.
+// 'sha256' is the file's digest. Returns 1 if the entry was stored.
+int download_cache_store(const DownloadCache* cache, const char* key, const char* filename, long long size, const char* sha256) {
+    char keyPath[MAX_PATH];
+    char objectPath[MAX_PATH];
+    char tmpPath[MAX_PATH];
+    FILE* file;
+    int ok = 0;
+
+    if (size > cache->maxBytes) return 0;
+
+    HANDLE hLock = cache_lock(cache);
+    if (hLock == INVALID_HANDLE_VALUE) return 0;
+
+    // Objects are written under a temp name and renamed, so a reader never sees a partial file.
+    // Copy rather than link: the downloaded file stays writable by the user.
+    cache_object_path(cache, sha256, objectPath, sizeof(objectPath));
+    if (GetFileAttributesA(objectPath) != INVALID_FILE_ATTRIBUTES) {
+        // Reuse an existing object only if it still matches; replace it otherwise
+        char actual[65];
+        long long actualSize = 0;
+        if (!sha256_file(objectPath, actual, &actualSize) || actualSize != size || strcmp(actual, sha256) != 0) {
+            printf("Cache: object %s is corrupt, replacing it\n", sha256);
+            cache_delete_object(objectPath);
+        }
+    }
+    if (GetFileAttributesA(objectPath) == INVALID_FILE_ATTRIBUTES) {
+        snprintf(tmpPath, sizeof(tmpPath), "%s.tmp%lu", objectPath, GetCurrentProcessId());
+        if (!CopyFileA(filename, tmpPath, FALSE) || !MoveFileExA(tmpPath, objectPath, 0)) {
+            DeleteFileA(tmpPath);
+            goto unlock;
+        }
+    }
+    SetFileAttributesA(objectPath, FILE_ATTRIBUTE_READONLY);
+
+    cache_key_path(cache, key, keyPath, sizeof(keyPath));
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp%lu", keyPath, GetCurrentProcessId());
+    if (fopen_s(&file, tmpPath, "w") != 0) goto unlock;
+    fprintf(file, "%s\n%lld\n%s\n", key, size, sha256);
+    if (fclose(file) != 0 || !MoveFileExA(tmpPath, keyPath, MOVEFILE_REPLACE_EXISTING)) {
+        DeleteFileA(tmpPath);
+        goto unlock;
+    }
+    ok = 1;
+    cache_evict(cache);
+
+unlock:
+    cache_unlock(hLock);
+    return ok;
+}
+
+// ---------------------------------------------------------------------------
+// Benchmark mode (--bench)
+//
+// Replays synthetic and recorded AT streams through the same receive path the
+// download uses: ring_buffer_put_bulk() on the producer side and
+// read_line_from_buffer() / parse_data_frame_header() / read_data_frame_payload()
+// on the consumer side. Each scenario runs twice:
+//   - single-threaded, alternating fill and drain with no sleeping. Its ns/byte
+//     measures the components alone and is the figure compared to the baseline.
+//   - with a producer thread, as in a real download. Lock acquisitions and the
+//     Sleep(1) stall times come from this run and are reported only.
+// Every run also verifies the decoded DATA frames against the stream.
+// ---------------------------------------------------------------------------
+
+#define BENCH_STREAM_BYTES (2 * 1024 * 1024)
+#define BENCH_MAX_SCENARIOS 32
+// Single-threaded runs per scenario; the fastest one is kept
+#define BENCH_REPEATS 5
+#define BENCH_DEFAULT_BASELINE "bench_baseline.txt"
+// Recorded streams replayed when no capture files are given
+#define BENCH_CAPTURE_DIR "bench\\captures"
+// Allowed ns/byte increase over the baseline, in percent
+#define BENCH_DEFAULT_THRESHOLD 10.0
+
+typedef struct {
+    char name[64];
+    char* stream;
+    int length;
+    int chunk;               // bytes handed to ring_buffer_write_all() per call
+    int frames;              // expected number of DATA frames
+    unsigned int checksum;   // expected checksum over all payload bytes
+} BenchScenario;
+
+typedef struct {
+    char name[64];
+    double nsPerByte;        // single-threaded, stall free (gated)
+    double wallNsPerByte;    // threaded run, including stalls
+    double mbPerSec;
+    double locksPerMB;
+    double producerStallMs;
+    double consumerStallMs;
+} BenchResult;
+
+typedef struct {
+    RingBuffer* rb;
+    const char* stream;
+    int length;
+    int chunk;
+    volatile int done;
+} BenchProducer;
+
+static unsigned int bench_rand(unsigned int* seed) {
+    *seed = *seed * 1103515245u + 12345u;
+    return *seed >> 16;
+}
+
+static unsigned int bench_checksum(unsigned int sum, const char* data, int len) {
+    for (int i = 0; i < len; ++i) {
+        sum = sum * 31 + (unsigned char)data[i];
+    }
+    return sum;
+}
+
+// Walk a stream the way the consumer does (lines capped like read_line_from_buffer,
+// DATA payloads skipped by length). Counts frames and payload checksum and returns
+// the length of the prefix that ends on a complete line or frame.
+static int bench_scan_stream(const char* stream, int length, int* frames, unsigned int* checksum) {
+    char line[256];
+    int pos = 0;
+
+    *frames = 0;
+    *checksum = 0;
+    while (pos < length) {
+        const char* nl = (const char*)memchr(stream + pos, '\n', (size_t)(length - pos));
+        if (!nl) break;
+        int toCopy = (int)(nl - (stream + pos)) + 1;
+        if (toCopy > (int)sizeof(line) - 1) toCopy = (int)sizeof(line) - 1;
+        memcpy(line, stream + pos, toCopy);
+        line[toCopy] = '\0';
+
+        int data_len = parse_data_frame_header(line);
+        if (data_len > 0) {
+            if (pos + toCopy + data_len > length) break; // truncated frame
+            *checksum = bench_checksum(*checksum, stream + pos + toCopy, data_len);
+            (*frames)++;
+            pos += data_len;
+        }
+        pos += toCopy;
+    }
+    return pos;
+}
+
+static void bench_append(BenchScenario* sc, const char* data, int len) {
+    memcpy(sc->stream + sc->length, data, len);
+    sc->length += len;
+}
+
+// Build a synthetic download stream: command echo, OK, DATA frame, +CFTPSGET: 0.
+// With 'mixed' set, frame sizes vary and unsolicited lines are interleaved.
+static int bench_build_synthetic(BenchScenario* sc, const char* name, int chunk, int frameSize, int mixed) {
+    static const char* urcs[] = { "\r\n+CSQ: 21,99\r\n", "\r\n+CPIN: READY\r\n", "\r\nRDY\r\n", "\r\n+CGEV: ME PDN ACT 1\r\n" };
+    static const char trailer[] = "\r\n+CFTPSGET: 0\r\n";
+    unsigned int seed = 0x5EED1234u;
+    char header[128];
+    int offset = 0;
+
+    snprintf(sc->name, sizeof(sc->name), "%s", name);
+    sc->chunk = chunk;
+    sc->length = 0;
+    sc->frames = 0;
+    sc->checksum = 0;
+    sc->stream = (char*)malloc(BENCH_STREAM_BYTES + MAX_PACKET_SIZE + 512);
+    if (!sc->stream) return 0;
+
+    while (sc->length < BENCH_STREAM_BYTES) {
+        int frameLen = mixed ? 1 + (int)(bench_rand(&seed) % frameSize) : frameSize;
+
+        if (mixed && (bench_rand(&seed) & 1)) {
+            const char* urc = urcs[bench_rand(&seed) % (sizeof(urcs) / sizeof(urcs[0]))];
+            bench_append(sc, urc, (int)strlen(urc));
+        }
+
+        int n = snprintf(header, sizeof(header), "AT+CFTPSGET=\"bench.bin\",%d,%d\r\r\nOK\r\n\r\n+CFTPSGET: DATA,%d\r\n",
+            offset, frameLen, frameLen);
+        bench_append(sc, header, n);
+
+        char* payload = sc->stream + sc->length;
+        for (int i = 0; i < frameLen; ++i) {
+            payload[i] = (char)bench_rand(&seed);
+        }
+        sc->length += frameLen;
+        sc->checksum = bench_checksum(sc->checksum, payload, frameLen);
+        sc->frames++;
+        offset += frameLen;
+
+        bench_append(sc, trailer, (int)sizeof(trailer) - 1);
+    }
+    return 1;
+}
+
+// Load a recorded AT stream (raw bytes as received from the module) and repeat it
+// until it is at least BENCH_STREAM_BYTES long.
+static int bench_load_capture(BenchScenario* sc, const char* path) {
+    FILE* file;
+    sc->stream = NULL;
+    if (fopen_s(&file, path, "rb") != 0) {
+        printf("Unable to open capture %s\n", path);
+        return 0;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    if (size <= 0 || size > 256L * 1024 * 1024) {
+        printf("Capture %s is empty or too large\n", path);
+        fclose(file);
+        return 0;
+    }
+
+    int copies = size >= BENCH_STREAM_BYTES ? 1 : (BENCH_STREAM_BYTES + (int)size - 1) / (int)size;
+    sc->stream = (char*)malloc((size_t)size * copies);
+    if (!sc->stream || fread(sc->stream, 1, size, file) != (size_t)size) {
+        printf("Unable to read capture %s\n", path);
+        fclose(file);
+        free(sc->stream);
+        sc->stream = NULL;
+        return 0;
+    }
+    fclose(file);
+    for (int i = 1; i < copies; ++i) {
+        memcpy(sc->stream + (size_t)size * i, sc->stream, size);
+    }
+
+    // Scenario name is the file name with spaces replaced so the baseline stays one token per field
+    const char* base = path;
+    for (const char* p = path; *p; ++p) {
+        if (*p == '\\' || *p == '/') base = p + 1;
+    }
+    snprintf(sc->name, sizeof(sc->name), "capture:%s", base);
+    for (char* p = sc->name; *p; ++p) {
+        if (isspace((unsigned char)*p)) *p = '_';
+    }
+
+    sc->chunk = 256;
+    sc->length = bench_scan_stream(sc->stream, (int)size * copies, &sc->frames, &sc->checksum);
+    if (sc->length == 0) {
+        printf("Capture %s contains no complete lines\n", path);
+        free(sc->stream);
+        sc->stream = NULL;
+        return 0;
+    }
+    return 1;
+}
+
+DWORD WINAPI bench_producer_thread(LPVOID param) {
+    BenchProducer* producer = (BenchProducer*)param;
+    int pos = 0;
+
+    while (pos < producer->length) {
+        int n = producer->length - pos;
+        if (n > producer->chunk) n = producer->chunk;
+        ring_buffer_write_all(producer->rb, producer->stream + pos, n);
+        pos += n;
+    }
+    producer->done = 1;
+    return 0;
+}
+
+static int bench_check_decoded(const BenchScenario* sc, int frames, unsigned int checksum) {
+    if (frames != sc->frames || checksum != sc->checksum) {
+        printf("%s: decoded %d frames (checksum %08X), expected %d frames (checksum %08X)\n",
+            sc->name, frames, checksum, sc->frames, sc->checksum);
+        return 0;
+    }
+    return 1;
+}
+
+// Put stream bytes into the ring buffer, one chunk per call, until it is full or the
+// stream ends. Returns the number of bytes written.
+static int bench_fill(RingBuffer* rb, const BenchScenario* sc, int* pos) {
+    int written = 0;
+
+    while (*pos < sc->length) {
+        int n = sc->length - *pos;
+        if (n > sc->chunk) n = sc->chunk;
+        int w = ring_buffer_put_bulk(rb, sc->stream + *pos, n);
+        *pos += w;
+        written += w;
+        if (w < n) break;
+    }
+    return written;
+}
+
+// Decode the stream on one thread, refilling the ring buffer whenever the consumer
+// runs out of data, so no time is spent sleeping. Sets *nsPerByte for one pass.
+static int bench_run_single_threaded(const BenchScenario* sc, double* nsPerByte) {
+    RingBuffer rb;
+    LARGE_INTEGER freq, start, end;
+    char line[256];
+    char data[MAX_PACKET_SIZE];
+    int pos = 0;
+    int frames = 0;
+    unsigned int checksum = 0;
+
+    ring_buffer_init(&rb);
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&start);
+
+    for (;;) {
+        if (!read_line_from_buffer(&rb, line, sizeof(line))) {
+            // No complete line: refill, or stop once nothing more can be added
+            if (bench_fill(&rb, sc, &pos) == 0) break;
+            continue;
+        }
+
+        int data_len = parse_data_frame_header(line);
+        if (data_len > 0) {
+            if (data_len > (int)sizeof(data)) break;
+            while (ring_buffer_available(&rb) < data_len && bench_fill(&rb, sc, &pos) > 0) {
+            }
+            if (ring_buffer_available(&rb) < data_len) break;
+            read_data_frame_payload(&rb, data, data_len);
+            checksum = bench_checksum(checksum, data, data_len);
+            frames++;
+        }
+    }
+
+    QueryPerformanceCounter(&end);
+    DeleteCriticalSection(&rb.lock);
+
+    *nsPerByte = (double)(end.QuadPart - start.QuadPart) * 1e9 / (double)freq.QuadPart / sc->length;
+    return bench_check_decoded(sc, frames, checksum);
+}
+
+static int bench_run_threaded(const BenchScenario* sc, BenchResult* result) {
+    RingBuffer rb;
+    BenchProducer producer;
+    LARGE_INTEGER freq, start, end;
+    char line[256];
+    int frames = 0;
+    unsigned int checksum = 0;
+
+    ring_buffer_init(&rb);
+    producer.rb = &rb;
+    producer.stream = sc->stream;
+    producer.length = sc->length;
+    producer.chunk = sc->chunk;
+    producer.done = 0;
+
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&start);
+
+    HANDLE hThread = CreateThread(NULL, 0, bench_producer_thread, &producer, 0, NULL);
+    if (hThread == NULL) {
+        printf("Unable to create producer thread\n");
+        DeleteCriticalSection(&rb.lock);
+        return 0;
+    }
+
+    for (;;) {
+        if (!read_line_from_buffer(&rb, line, sizeof(line))) {
+            // Producer finished and only a partial line (if anything) is left
+            if (producer.done && ring_buffer_find_char(&rb, '\n') == -1) break;
+            ring_buffer_stall(&rb.stats.consumerStallTicks);
+            continue;
+        }
+
+        int data_len = parse_data_frame_header(line);
+        if (data_len > 0) {
+            char* data = (char*)malloc(data_len);
+            read_data_frame_payload(&rb, data, data_len);
+            checksum = bench_checksum(checksum, data, data_len);
+            frames++;
+            free(data);
+        }
+    }
+
+    QueryPerformanceCounter(&end);
+    WaitForSingleObject(hThread, INFINITE);
+    CloseHandle(hThread);
+    DeleteCriticalSection(&rb.lock);
+
+    double elapsedNs = (double)(end.QuadPart - start.QuadPart) * 1e9 / (double)freq.QuadPart;
+    double megabytes = (double)sc->length / (1024.0 * 1024.0);
+    result->wallNsPerByte = elapsedNs / sc->length;
+    result->mbPerSec = megabytes / (elapsedNs / 1e9);
+    result->locksPerMB = (double)rb.stats.lockAcquisitions / megabytes;
+    result->producerStallMs = (double)rb.stats.producerStallTicks * 1000.0 / (double)freq.QuadPart;
+    result->consumerStallMs = (double)rb.stats.consumerStallTicks * 1000.0 / (double)freq.QuadPart;
+
+    return bench_check_decoded(sc, frames, checksum);
+}
+
+static int bench_run_scenario(const BenchScenario* sc, BenchResult* result) {
+    double ns;
+
+    snprintf(result->name, sizeof(result->name), "%s", sc->name);
+    result->nsPerByte = 0.0;
+    for (int i = 0; i < BENCH_REPEATS; ++i) {
+        if (!bench_run_single_threaded(sc, &ns)) return 0;
+        if (i == 0 || ns < result->nsPerByte) result->nsPerByte = ns;
+    }
+    return bench_run_threaded(sc, result);
+}
+
+// Look up a scenario's baseline ns/byte; returns 1 and sets *value if present
+static int bench_baseline_lookup(const char* path, const char* name, double* value) {
+    FILE* file;
+    char line[256];
+    char entry[64];
+    double v;
+
+    if (fopen_s(&file, path, "r") != 0) return 0;
+    while (fgets(line, sizeof(line), file)) {
+        if (line[0] == '#') continue;
+        if (sscanf_s(line, "%63s %lf", entry, (unsigned)sizeof(entry), &v) == 2 && strcmp(entry, name) == 0) {
+            *value = v;
+            fclose(file);
+            return 1;
+        }
+    }
+    fclose(file);
+    return 0;
+}
+
+static int bench_save_baseline(const char* path, const BenchResult* results, int count) {
+    FILE* file;
+    if (fopen_s(&file, path, "w") != 0) {
+        printf("Unable to write baseline %s\n", path);
+        return 0;
+    }
+    fprintf(file, "# SIMCom FTP Tool benchmark baseline: <scenario> <single-threaded ns/byte>\n");
+    for (int i = 0; i < count; ++i) {
+        fprintf(file, "%s %.4f\n", results[i].name, results[i].nsPerByte);
+    }
+    fclose(file);
+    printf("Baseline written to %s\n", path);
+    return 1;
+}
+
+// Add every capture in BENCH_CAPTURE_DIR; returns 0 if one could not be loaded
+static int bench_load_default_captures(BenchScenario* scenarios, int* count) {
+    WIN32_FIND_DATAA fd;
+    char path[MAX_PATH];
+    int ok = 1;
+
+    HANDLE hFind = FindFirstFileA(BENCH_CAPTURE_DIR "\\*.bin", &fd);
+    if (hFind == INVALID_HANDLE_VALUE) {
+        printf("Warning: no recorded streams found in %s\n", BENCH_CAPTURE_DIR);
+        return 1;
+    }
+    do {
+        if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) continue;
+        if (*count >= BENCH_MAX_SCENARIOS) {
+            printf("Too many captures in %s (at most %d scenarios)\n", BENCH_CAPTURE_DIR, BENCH_MAX_SCENARIOS);
+            ok = 0;
+            break;
+        }
+        snprintf(path, sizeof(path), "%s\\%s", BENCH_CAPTURE_DIR, fd.cFileName);
+        if (bench_load_capture(&scenarios[*count], path)) {
+            (*count)++;
+        }
+        else {
+            ok = 0;
+        }
+    } while (FindNextFileA(hFind, &fd));
+    FindClose(hFind);
+    return ok;
+}
+
+static void bench_usage(void) {
+    printf("Usage: --bench [--save] [--baseline <file>] [--threshold <percent>] [capture files...]\n");
+}
+
+// Usage: --bench [--save] [--baseline <file>] [--threshold <percent>] [capture files...]
+// Without capture files, the recorded streams in BENCH_CAPTURE_DIR are used.
+// Returns 0 on success, 1 on a usage error, a decoding failure, a missing baseline
+// entry or a throughput regression beyond the threshold.
+int run_benchmark(int argc, char** argv) {
+    static BenchScenario scenarios[BENCH_MAX_SCENARIOS];
+    static BenchResult results[BENCH_MAX_SCENARIOS];
+    const char* baselinePath = BENCH_DEFAULT_BASELINE;
+    double threshold = BENCH_DEFAULT_THRESHOLD;
+    int save = 0;
+    int count = 0;
+    int captures = 0;
+    int failed = 0;
+    int missing = 0;
+
+    // Parse and validate all arguments before doing any work
+    for (int i = 0; i < argc; ++i) {
+        if (strcmp(argv[i], "--save") == 0) {
+            save = 1;
+        }
+        else if (strcmp(argv[i], "--baseline") == 0) {
+            if (i + 1 >= argc) {
+                printf("--baseline requires a file name\n");
+                bench_usage();
+                return 1;
+            }
+            baselinePath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--threshold") == 0) {
+            char* end = NULL;
+            if (i + 1 < argc) threshold = strtod(argv[i + 1], &end);
+            if (i + 1 >= argc || end == argv[i + 1] || *end != '\0' || threshold < 0.0) {
+                printf("--threshold requires a non-negative number of percent\n");
+                bench_usage();
+                return 1;
+            }
+            ++i;
+        }
+        else if (strncmp(argv[i], "--", 2) == 0) {
+            printf("Unknown option %s\n", argv[i]);
+            bench_usage();
+            return 1;
+        }
+        else {
+            captures++;
+        }
+    }
+
+    // Built-in scenarios: bulk 256-byte producer writes (matches serial_receive_thread),
+    // single-byte writes, odd-sized writes/frames that straddle the buffer end, and
+    // variable frames mixed with unsolicited result codes.
+    if (captures > BENCH_MAX_SCENARIOS - 4) {
+        printf("Too many capture files (at most %d)\n", BENCH_MAX_SCENARIOS - 4);
+        bench_usage();
+        return 1;
+    }
+    if (!bench_build_synthetic(&scenarios[count++], "bulk_256", 256, 4096, 0) ||
+        !bench_build_synthetic(&scenarios[count++], "single_byte", 1, 4096, 0) ||
+        !bench_build_synthetic(&scenarios[count++], "wraparound", 3001, 4093, 0) ||
+        !bench_build_synthetic(&scenarios[count++], "mixed", 256, 4096, 1)) {
+        printf("Out of memory building benchmark streams\n");
+        return 1;
+    }
+
+    if (captures == 0) {
+        if (!bench_load_default_captures(scenarios, &count)) failed = 1;
+    }
+    for (int i = 0; i < argc; ++i) {
+        if (strcmp(argv[i], "--baseline") == 0 || strcmp(argv[i], "--threshold") == 0) {
+            ++i;
+        }
+        else if (strncmp(argv[i], "--", 2) != 0) {
+            if (bench_load_capture(&scenarios[count], argv[i])) {
+                count++;
+            }
+            else {
+                failed = 1;
+            }
+        }
+    }
+
+    printf("%-36s %10s %10s %10s %12s %14s %14s %10s\n",
+        "scenario", "ns/byte", "wall ns/B", "wall MB/s", "locks/MB", "prod stall ms", "cons stall ms", "baseline");
+    for (int i = 0; i < count; ++i) {
+        BenchResult* r = &results[i];
+        double base = 0.0;
+
+        if (!bench_run_scenario(&scenarios[i], r)) {
+            failed = 1;
+        }
+
+        printf("%-36s %10.3f %10.3f %10.2f %12.0f %14.1f %14.1f ",
+            r->name, r->nsPerByte, r->wallNsPerByte, r->mbPerSec, r->locksPerMB, r->producerStallMs, r->consumerStallMs);
+        if (save) {
+            printf("%10s\n", "-");
+        }
+        else if (bench_baseline_lookup(baselinePath, r->name, &base)) {
+            double change = (r->nsPerByte - base) / base * 100.0;
+            if (change > threshold) {
+                printf("%+9.1f%% REGRESSION\n", change);
+                failed = 1;
+            }
+            else {
+                printf("%+9.1f%%\n", change);
+            }
+        }
+        else {
+            printf("%10s\n", "MISSING");
+            missing = 1;
+        }
+        free(scenarios[i].stream);
+    }
+
+    if (missing) {
+        printf("No baseline entry in %s for some scenarios; run with --save to record one\n", baselinePath);
+        failed = 1;
+    }
+    if (save && !failed && !bench_save_baseline(baselinePath, results, count)) {
+        failed = 1;
+    }
+    return failed ? 1 : 0;
+}
+
 int main(int argc, char** argv) {
     SerialPort serial;
     RingBuffer rxBuffer;
@@ -546,6 +1556,39 @@ int main(int argc, char** argv) {
     char ftp_pass[128] = { 0 };
     char ftp_filename[260] = { 0 };
     int baudRate = 115200; // default baud rate
+    char ftp_sha256[65] = { 0 }; // optional expected SHA-256 of the remote file
+    DownloadCache cache;
+    int useCache = 0;       // --cache: look up and store downloads in the local cache
+    int refreshCache = 0;   // --refresh-cache: always download, then replace the cache entry
+    int cacheHardlink = 0;  // --cache-hardlink: restore hits as read-only hardlinks
+    int exitCode = 0;
+
+    // Benchmark mode does not touch the serial port
+    if (argc >= 2 && strcmp(argv[1], "--bench") == 0) {
+        return run_benchmark(argc - 2, argv + 2);
+    }
+
+    // Cache options may appear anywhere; remove them before reading positional arguments
+    {
+        int positional = 1;
+        for (int i = 1; i < argc; ++i) {
+            if (strcmp(argv[i], "--cache") == 0) {
+                useCache = 1;
+            }
+            else if (strcmp(argv[i], "--refresh-cache") == 0) {
+                useCache = 1;
+                refreshCache = 1;
+            }
+            else if (strcmp(argv[i], "--cache-hardlink") == 0) {
+                useCache = 1;
+                cacheHardlink = 1;
+            }
+            else {
+                argv[positional++] = argv[i];
+            }
+        }
+        argc = positional;
+    }
 
     if (argc >= 7) {
         // argv[1] = COM (e.g., COM3)
@@ -561,6 +1604,11 @@ int main(int argc, char** argv) {
             int b = atoi(argv[7]);
             if (b > 0) baudRate = b;
         }
+        // Optional 9th argument: expected SHA-256 of the file (part of the cache key, verified after download)
+        if (argc >= 9 && !normalize_sha256(argv[8], ftp_sha256)) {
+            printf("Invalid SHA-256: %s\n", argv[8]);
+            return 1;
+        }
     }
     else {
         // interactive input (existing behavior)
@@ -671,11 +1719,51 @@ int main(int argc, char** argv) {
     }
     printf("Total file size: %d bytes\n", file_size);
 
-    // 7. Download file
+    // 7. Download file, unless an identical copy is already in the local cache
     printf("\n7. Start downloading file...\n");
-    if (!download_file_data(serial.hCom, &rxBuffer, ftp_filename, file_size)) {
-        printf("File download failed\n");
-        goto cleanup;
+    {
+        char cacheKey[CACHE_KEY_SIZE];
+        char digest[65];
+        long long digestSize = 0;
+        int cacheEnabled = useCache && download_cache_open(&cache);
+
+        cache.hardlink = cacheHardlink;
+        if (cacheEnabled && !cache_make_key(cacheKey, sizeof(cacheKey), ftp_server, ftp_port, ftp_user, ftp_filename, file_size, ftp_sha256)) {
+            printf("Cache: key for %s is too long, cache disabled\n", ftp_filename);
+            cacheEnabled = 0;
+        }
+        if (cacheEnabled && !refreshCache && download_cache_fetch(&cache, cacheKey, file_size, ftp_filename)) {
+            printf("Cache hit, %s restored from %s (%d bytes)\n", ftp_filename, cache.dir, file_size);
+        }
+        else {
+            // A hardlink into the cache (from --cache-hardlink) is deleted rather than truncated
+            // so the cached object is never overwritten; other files are left to fopen_s as before
+            if (file_is_hardlinked(ftp_filename)) {
+                SetFileAttributesA(ftp_filename, FILE_ATTRIBUTE_NORMAL);
+                DeleteFileA(ftp_filename);
+            }
+            if (!download_file_data(serial.hCom, &rxBuffer, ftp_filename, file_size)) {
+                printf("File download failed\n");
+                goto cleanup;
+            }
+            if (cacheEnabled || ftp_sha256[0]) {
+                if (!sha256_file(ftp_filename, digest, &digestSize)) {
+                    printf("Unable to hash %s, not caching\n", ftp_filename);
+                }
+                else if (ftp_sha256[0] && strcmp(digest, ftp_sha256) != 0) {
+                    printf("SHA-256 mismatch: expected %s, got %s, deleting %s\n", ftp_sha256, digest, ftp_filename);
+                    DeleteFileA(ftp_filename);
+                    exitCode = 1;
+                    goto cleanup;
+                }
+                else if (cacheEnabled && digestSize != file_size) {
+                    printf("Cache: downloaded %lld bytes but AT+CFTPSSIZE reported %d, not caching\n", digestSize, file_size);
+                }
+                else if (cacheEnabled && download_cache_store(&cache, cacheKey, ftp_filename, digestSize, digest)) {
+                    printf("Cached %s in %s\n", ftp_filename, cache.dir);
+                }
+            }
+        }
     }
 
     printf("\n=== All operations completed ===\n");
@@ -688,5 +1776,5 @@ cleanup:
     CloseHandle(serial.hCom);
     DeleteCriticalSection(&rxBuffer.lock);
 
-    return 0;
+    return exitCode;
 }
\ No newline at end of file